@@ -7,7 +7,7 @@
 #include "CBEMD.h"
 
 /*!
- \param \*argv[] ./andersen nsteps dt xml_file energy_file animation_file temperature nu
+ \param \*argv[] ./andersen nsteps dt xml_file energy_file animation_file temperature nu [parallel_method]
  The input arguments are as follows:
  
  nsteps Number of timesteps to run for.
@@ -23,6 +23,9 @@
  temperature Desired reduced temperature.
  
  nu Coupling constant to thermal heat bath (``collision" frequency).
+ 
+ parallel_method Optional, how pairs are divided among processors: shell (default) or midpoint.  midpoint only imports atoms within
+ max_rcut/2 of each domain, which pays off when domains are small compared to max_rcut.
  */
 int main (int argc, char *argv[]) {
 	int check;
@@ -30,8 +33,8 @@ int main (int argc, char *argv[]) {
 	double dt;
 	System mysys; //Declare system
 	
-	if (argc != 8) {
-		fprintf(stderr, "syntax: ./andersen nsteps dt xml_file energy_file animation_file temperature nu \n");
+	if (argc != 8 && argc != 9) {
+		fprintf(stderr, "syntax: ./andersen nsteps dt xml_file energy_file animation_file temperature nu [parallel_method] \n");
 		return ILLEGAL_VALUE;
 	}
 	
@@ -63,6 +66,14 @@ int main (int argc, char *argv[]) {
 	if (check != 0) {
 		goto finalize;
 	}
+
+	// Choose the parallel method
+	if (argc == 9) {
+		check = set_parallel_method (argv[8], &mysys);
+		if (check != 0) {
+			goto finalize;
+		}
+	}
 	
 	// Initialize coordinates
 	check = initialize_from_files (argv[3], argv[4], &mysys);
@@ -5,96 +5,98 @@
 */
 
 #include "domain_decomp.h"
+#include <cstring>
 
 /*!
- Given the box size and factors of nprocs, this recursive function checks which combination generates the most cubic domains
- \param [in] factors list of prime factors to be used
+ Given the box size, the maximum cutoff radius and the number of processors, chooses how many times to divide each dimension of the box.
+ Every grid px*py*pz = nprocs is enumerated directly from the divisors of nprocs. Grids whose domains are narrower than rcut
+ in any dimension are rejected, since only neighbouring domains are allowed to interact. Of the remaining grids, the one whose domains import
+ the smallest ghost shell is chosen (see halo_ratio), so both the box shape and rcut are accounted for.
+ Returns 0 if a grid was found, 1 if no grid satisfies the cutoff.
  \param [in] box dimensions of the simulation box
- \param [in] level the depth of the recursion
- \param [out] final_breakup the number of divisions of each dimension
- \param [in] add the number of times to be spent at this level of recursion
+ \param [in] nprocs number of processors
+ \param [in] rcut maximum cutoff radius of the interactions (0 if not yet known)
+ \param [out] breakup the number of divisions of each dimension
 */
-void gen_sets (const vector<int>& factors, const double box[], const int level, double& final_diff, vector<int>& final_breakup, int add) {
+int select_grid (const double box[], const int nprocs, const double rcut, int breakup[]) {
+    double widths[NDIM], cost, best_cost=-1.0;
+    int grid[NDIM], divided[NDIM];
 
-    vector<int> remaining;
-    double widths[NDIM];
-    static int breakup[NDIM]={1,1,1};
-    
-    if (factors.size() == 0) {
-		for (int m=0; m<NDIM; m++) {
-			widths[m] = box[m] / breakup[m];
-		}
-		double diff = (widths[1]-widths[0])*(widths[1]-widths[0]) + (widths[2]-widths[1])*(widths[2]-widths[1]) + (widths[0]-widths[2])*(widths[0]-widths[2]);
-		if (diff <= final_diff) {
-			for (vector<int>::size_type m=0; m!=final_breakup.capacity(); m++) {
-				final_breakup.at(m) = breakup[m];
-			}
-			final_diff = diff;
-		}
-		return;
-    } else if (level != 0 && add != 0) {
-		for (unsigned int j=0; j<factors.size(); j++) {
-			breakup[level-1] *= factors[j];
-			remaining = factors;
-			remaining.erase (remaining.begin()+j);
-			gen_sets(remaining, box, level, final_diff, final_breakup, add-1);
-			breakup[level-1] /= factors[j];
+    for (grid[0]=1; grid[0]<=nprocs; grid[0]++) {
+	if (nprocs%grid[0] != 0) {
+	    continue;
+	}
+	for (grid[1]=1; grid[1]<=nprocs/grid[0]; grid[1]++) {
+	    if ((nprocs/grid[0])%grid[1] != 0) {
+		continue;
+	    }
+	    grid[2] = nprocs/grid[0]/grid[1];
+
+	    bool too_narrow = false;
+	    for (int m=0; m<NDIM; m++) {
+		widths[m] = box[m]/grid[m];
+		// When rcut is not yet known every dimension is treated as divided, which favours the most cubic domains
+		divided[m] = (grid[m] > 1 || rcut <= 0.0);
+		if (widths[m] < rcut) {
+		    too_narrow = true;
 		}
-    } else if (level == 0 && add == 0) {
+	    }
+	    if (too_narrow) {
+		continue;
+	    }
+
+	    /* Ghost shell volume divided by 2*rcut, which remains well defined (the area of the faces shared with neighbours) when rcut = 0.
+	       Undivided dimensions have no neighbours to import from. */
+	    cost = 4.0*rcut*rcut*divided[0]*divided[1]*divided[2];
+	    for (int m=0; m<NDIM; m++) {
+		cost += divided[m]*widths[(m+1)%NDIM]*widths[(m+2)%NDIM] + 2.0*rcut*divided[(m+1)%NDIM]*divided[(m+2)%NDIM]*widths[m];
+	    }
+	    if (best_cost < 0 || cost < best_cost) {
+		best_cost = cost;
 		for (int m=0; m<NDIM; m++) {
-			breakup[m] = 1;
-		}
-		for (int i=1; i<=((int)factors.size()-2); i++) {
-			gen_sets(factors, box, 1, final_diff, final_breakup, i);
-		}
-    } else if (level == 2 && add == 0) {
-		gen_sets(factors, box, level+1, final_diff, final_breakup, factors.size());
-    } else if (level != 0 && add == 0) {
-		for (int k=1; k<=((int)factors.size()+level-2); k++) {
-			gen_sets(factors, box, level+1, final_diff, final_breakup, k);
+		    breakup[m] = grid[m];
 		}
+	    }
+	}
+    }
+    if (best_cost < 0) {
+	return 1;
     }
-    return;
-} //gen_sets ends
+    return 0;
+} // select_grid ends
 
 /*!
- Given a number returns the prime factors of that number.
- This function does not count 1 as a prime factor.
- \param [in] nprocs number of processors
+ Ratio of the volume of the ghost shell a domain imports from its neighbours to the volume of the domain.
+ The shell extends rcut past both sides of the domain along every dimension that is divided among processors.
+ \param [in] widths the dimensions of each domain
+ \param [in] breakup the number of divisions of each dimension
+ \param [in] rcut maximum cutoff radius of the interactions
 */
-
-vector <int> factorize (const int nprocs) {
-
-    vector <int> factors;
-    int unfactored=nprocs;
-    int i=2;
-    while (i<=unfactored) {
-	if ((unfactored%i) == 0) {
-	    factors.push_back(i);
-	    unfactored /= i;
-	    i=2;
+double halo_ratio (const double widths[], const int breakup[], const double rcut) {
+    double interior=1.0, with_halo=1.0;
+    for (int m=0; m<NDIM; m++) {
+	interior *= widths[m];
+	if (breakup[m] > 1) {
+	    with_halo *= widths[m]+2.0*rcut;
 	} else {
-	    i++;
+	    with_halo *= widths[m];
 	}
     }
-    if (factors.size() == 0) {
-	factors.push_back(1);
-    }
-    return factors;
-} // factorize ends
+    return (with_halo-interior)/interior;
+}
 
 /*!
- Decomposes the box into domains for each processor to handle
+ Decomposes the box into domains for each processor to handle. Returns 0 if successful, 1 if no decomposition has domains at least rcut wide.
  \param [in] box dimensions of the simulation box
  \param [in] nprocs number of processors
  \param [in] widths the dimensions of each domain
  \param [out] final_breakup the number of divisions of each dimension
+ \param [in] rcut maximum cutoff radius of the interactions
 */
-int init_domain_decomp (const vector<double> box, const int nprocs, double widths[], vector<int>& final_breakup) {
+int init_domain_decomp (const vector<double> box, const int nprocs, double widths[], vector<int>& final_breakup, const double rcut) {
 
     double box_dims[NDIM];
-    double final_diff=10000;
-    vector<int> factors;
+    int breakup[NDIM];
 
     final_breakup.resize(NDIM, -1);
 	
@@ -102,33 +104,310 @@ int init_domain_decomp (const vector<double> box, const int nprocs, double width
 	box_dims[i] = box[i];
     }
 
-    factors = factorize (nprocs);
-    // Two 1's added to the factors to ensure deompositions like 1,1,6 are found
-    factors.push_back(1);
-    factors.push_back(1);
-
-    // gen_sets is a recursive function, initial call must have level=0 and add=0
-    gen_sets(factors, box_dims, 0, final_diff, final_breakup, 0);
+    if (select_grid (box_dims, nprocs, rcut, breakup) != 0) {
+	return 1;
+    }
     for (int i=0; i<NDIM; i++) {
+	final_breakup[i] = breakup[i];
 	widths[i] = box_dims[i] / final_breakup[i];
     }
 
     return 0;
 } // init_domain_decomp ends
 
+/*!
+ Decomposes the box of a System among all processors, records the extents and neighbours of this processor's domain,
+ and discards the atoms which belong to other domains.  The box and max_rcut must already be known, i.e. the coordinate
+ and energy files must have been read.  Returns SAFE_EXIT if successful, else an error flag.
+ \param [in,out] sys System to decompose
+*/
+int setup_domain_decomp (System *sys) {
+    char err_msg[MYERR_FLAG_SIZE];
+    int nprocs, rank;
+    MPI_Comm_size (MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank (MPI_COMM_WORLD, &rank);
+
+    if (init_domain_decomp (sys->box(), nprocs, sys->proc_widths, sys->final_proc_breakup, halo_width (sys)) != 0) {
+	sprintf(err_msg, "No decomposition of the box among %d processors has domains at least as wide as the halo (%g), cannot use this many processors", nprocs, halo_width (sys));
+	flag_error (err_msg, __FILE__, __LINE__);
+	return ILLEGAL_VALUE;
+    }
+    if (rank == 0) {
+	sprintf(err_msg, "Using %d x %d x %d domains of size (%g, %g, %g), predicted halo to interior volume ratio = %g", sys->final_proc_breakup[0], sys->final_proc_breakup[1], sys->final_proc_breakup[2], sys->proc_widths[0], sys->proc_widths[1], sys->proc_widths[2], halo_ratio (sys->proc_widths, &sys->final_proc_breakup[0], halo_width (sys)));
+	flag_notify (err_msg, __FILE__, __LINE__);
+    }
+
+    // Decide which domain this processor handles; from here on sys->rank() is the domain id
+    place_domains (sys);
+    if (sys->gen_domain_info() != 0) {
+	sprintf(err_msg, "Could not locate the domain of rank %d", rank);
+	flag_error (err_msg, __FILE__, __LINE__);
+	return ILLEGAL_VALUE;
+    }
+    gen_send_table (sys);
+
+    // Keep only the atoms inside this processor's domain
+    vector <int> to_delete;
+    for (int i=0; i<sys->natoms(); i++) {
+	if (get_processor (sys->get_atom(i)->pos, sys) != sys->rank()) {
+	    to_delete.push_back(i);
+	}
+    }
+    sys->delete_atoms(to_delete);
+    return SAFE_EXIT;
+}
+
+/*!
+ Chooses the shape of the block of domains each node should handle so that as little halo traffic as possible crosses between nodes.
+ The block must tile the grid exactly and contain node_size domains; of those, the block whose domains import the smallest volume of
+ halo (faces, edges and corners) from domains on other nodes is chosen.  Returns 0 if a block was found, 1 otherwise.
+ \param [in] breakup the number of divisions of each dimension
+ \param [in] widths the dimensions of each domain
+ \param [in] rcut the width of the halo
+ \param [in] node_size the number of processors on each node
+ \param [out] block the number of domains along each dimension of the block
+*/
+int node_block (const int breakup[], const double widths[], const double rcut, const int node_size, int block[]) {
+    double cost, volume, best_cost=-1.0;
+    int shape[NDIM], offset[NDIM], local_xyz[NDIM];
+
+    for (shape[0]=1; shape[0]<=breakup[0]; shape[0]++) {
+	for (shape[1]=1; shape[1]<=breakup[1]; shape[1]++) {
+	    if (node_size%(shape[0]*shape[1]) != 0) {
+		continue;
+	    }
+	    shape[2] = node_size/(shape[0]*shape[1]);
+	    if (breakup[0]%shape[0] != 0 || breakup[1]%shape[1] != 0 || breakup[2]%shape[2] != 0) {
+		continue;
+	    }
+	    // Sum the halo each domain of the block imports from domains outside it; a block spanning a whole dimension wraps onto itself
+	    cost = 0.0;
+	    for (int local=0; local<node_size; local++) {
+		local_xyz[0] = local%shape[0];
+		local_xyz[1] = (local/shape[0])%shape[1];
+		local_xyz[2] = local/(shape[0]*shape[1]);
+		for (int slot=0; slot<NNEIGHBORS; slot++) {
+		    bool outside = false;
+		    volume = 1.0;
+		    for (int m=0, value=slot+1; m<NDIM; m++, value/=3) {
+			offset[m] = (value%3 == 2) ? 1 : -(value%3);
+			if (offset[m] != 0 && breakup[m] == 1) {
+			    volume = 0.0;
+			}
+			if (shape[m] < breakup[m] && (local_xyz[m]+offset[m] < 0 || local_xyz[m]+offset[m] >= shape[m])) {
+			    outside = true;
+			}
+			volume *= (offset[m] == 0) ? widths[m] : rcut;
+		    }
+		    if (outside) {
+			cost += volume;
+		    }
+		}
+	    }
+	    if (best_cost < 0 || cost < best_cost) {
+		best_cost = cost;
+		for (int m=0; m<NDIM; m++) {
+		    block[m] = shape[m];
+		}
+	    }
+	}
+    }
+    if (best_cost < 0) {
+	return 1;
+    }
+    return 0;
+}
+
+/*!
+ Predicts the number of bytes of halo atoms sent between processors on different nodes each step, assuming atoms are spread uniformly.
+ \param [in] sys System whose decomposition is used
+ \param [in] rank_of_domain the processor (rank in MPI_COMM_WORLD) handling each domain
+ \param [in] node_of_rank the node each processor runs on
+*/
+double internode_halo_bytes (const System *sys, const vector<int>& rank_of_domain, const vector<int>& node_of_rank) {
+    const vector<double> box = sys->box();
+    const double density = sys->global_atom_types.size()/(box[0]*box[1]*box[2]);
+    const int ndomains = rank_of_domain.size();
+    int xyz_id[NDIM], ngh_xyz_id[NDIM], offset[NDIM], neighbor;
+    double volume, bytes=0.0;
+
+    for (int domain=0; domain<ndomains; domain++) {
+	xyz_id[0] = domain%sys->final_proc_breakup[0];
+	xyz_id[1] = (domain/sys->final_proc_breakup[0])%sys->final_proc_breakup[1];
+	xyz_id[2] = domain/(sys->final_proc_breakup[0]*sys->final_proc_breakup[1]);
+	for (int slot=0; slot<NNEIGHBORS; slot++) {
+	    // Recover the offset of this neighbour from its index (see neighbor_index)
+	    volume = 1.0;
+	    bool undivided = false;
+	    for (int m=0, value=slot+1; m<NDIM; m++, value/=3) {
+		offset[m] = (value%3 == 2) ? 1 : -(value%3);
+		ngh_xyz_id[m] = (xyz_id[m]+offset[m]+sys->final_proc_breakup[m])%sys->final_proc_breakup[m];
+		if (offset[m] != 0 && sys->final_proc_breakup[m] == 1) {
+		    undivided = true;
+		}
+		volume *= (offset[m] == 0) ? sys->proc_widths[m] : halo_width (sys);
+	    }
+	    if (undivided) {
+		continue;
+	    }
+	    neighbor = get_processor (ngh_xyz_id[0], ngh_xyz_id[1], ngh_xyz_id[2], sys->final_proc_breakup);
+	    if (node_of_rank[rank_of_domain[domain]] != node_of_rank[rank_of_domain[neighbor]]) {
+		bytes += volume*density*sizeof(Atom);
+	    }
+	}
+    }
+    return bytes;
+}
+
+/*!
+ Decides which domain each processor handles and creates sys->domain_comm, in which each processor's rank is the id of its domain.
+ Processors are grouped into nodes by processor name.  When every node runs the same number of processors and the grid can be tiled
+ by blocks of that many domains, each node is given one compact block (see node_block) so most halo traffic stays within a node.  Otherwise
+ placement is left to MPI_Cart_create with reordering allowed.  The predicted inter-node halo traffic is reported before (domain id = rank)
+ and after placement.  Returns SAFE_EXIT.
+ \param [in,out] sys System whose domains to place
+*/
+int place_domains (System *sys) {
+    char err_msg[MYERR_FLAG_SIZE], name[MPI_MAX_PROCESSOR_NAME];
+    int nprocs, world_rank, domain_id, name_length, grid[NDIM], block[NDIM];
+    MPI_Comm_size (MPI_COMM_WORLD, &nprocs);
+    MPI_Comm_rank (MPI_COMM_WORLD, &world_rank);
+
+    // Number the nodes in order of the lowest rank running on each
+    memset (name, 0, MPI_MAX_PROCESSOR_NAME);
+    MPI_Get_processor_name (name, &name_length);
+    vector<char> all_names (nprocs*MPI_MAX_PROCESSOR_NAME);
+    MPI_Allgather (name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, &all_names[0], MPI_MAX_PROCESSOR_NAME, MPI_CHAR, MPI_COMM_WORLD);
+    map<string, int> node_index;
+    vector<int> node_of_rank (nprocs);
+    vector< vector<int> > ranks_on_node;
+    for (int i=0; i<nprocs; i++) {
+	string node_name (&all_names[i*MPI_MAX_PROCESSOR_NAME]);
+	if (node_index.find(node_name) == node_index.end()) {
+	    node_index[node_name] = ranks_on_node.size();
+	    ranks_on_node.push_back(vector<int>());
+	}
+	node_of_rank[i] = node_index[node_name];
+	ranks_on_node[node_of_rank[i]].push_back(i);
+    }
+
+    bool uniform = (ranks_on_node.size() > 1);
+    for (unsigned int i=0; i<ranks_on_node.size(); i++) {
+	if (ranks_on_node[i].size() != ranks_on_node[0].size()) {
+	    uniform = false;
+	}
+    }
+    for (int m=0; m<NDIM; m++) {
+	grid[m] = sys->final_proc_breakup[m];
+    }
+
+    if (uniform && node_block (grid, sys->proc_widths, halo_width (sys), ranks_on_node[0].size(), block) == 0) {
+	// Block of domains this node handles, and this processor's place within it
+	int node = node_of_rank[world_rank];
+	int local = find (ranks_on_node[node].begin(), ranks_on_node[node].end(), world_rank) - ranks_on_node[node].begin();
+	int nblocks[NDIM], node_xyz[NDIM], local_xyz[NDIM];
+	for (int m=0; m<NDIM; m++) {
+	    nblocks[m] = grid[m]/block[m];
+	}
+	node_xyz[0] = node%nblocks[0];
+	node_xyz[1] = (node/nblocks[0])%nblocks[1];
+	node_xyz[2] = node/(nblocks[0]*nblocks[1]);
+	local_xyz[0] = local%block[0];
+	local_xyz[1] = (local/block[0])%block[1];
+	local_xyz[2] = local/(block[0]*block[1]);
+	domain_id = get_processor (node_xyz[0]*block[0]+local_xyz[0], node_xyz[1]*block[1]+local_xyz[1], node_xyz[2]*block[2]+local_xyz[2], sys->final_proc_breakup);
+	MPI_Comm_split (MPI_COMM_WORLD, 0, domain_id, &sys->domain_comm);
+    } else {
+	// MPI numbers Cartesian ranks with the last dimension fastest, whereas domain ids have x fastest
+	int dims[NDIM], periods[NDIM];
+	for (int m=0; m<NDIM; m++) {
+	    dims[m] = grid[NDIM-1-m];
+	    periods[m] = 1;
+	}
+	MPI_Cart_create (MPI_COMM_WORLD, NDIM, dims, periods, 1, &sys->domain_comm);
+    }
+    MPI_Comm_rank (sys->domain_comm, &domain_id);
+    sys->set_rank(domain_id);
+
+    // Compare the traffic between nodes with that of simply using domain id = rank
+    vector<int> rank_of_domain (nprocs), in_order (nprocs);
+    MPI_Allgather (&world_rank, 1, MPI_INT, &rank_of_domain[0], 1, MPI_INT, sys->domain_comm);
+    if (world_rank == 0) {
+	for (int i=0; i<nprocs; i++) {
+	    in_order[i] = i;
+	}
+	sprintf(err_msg, "Predicted inter-node halo traffic on %d node(s) is %g bytes per step with domains in rank order, %g bytes after placement", (int) ranks_on_node.size(), internode_halo_bytes (sys, in_order, node_of_rank), internode_halo_bytes (sys, rank_of_domain, node_of_rank));
+	flag_notify (err_msg, __FILE__, __LINE__);
+    }
+    return SAFE_EXIT;
+}
+
+/*!
+ Returns the width of the region around a domain from which atoms must be imported, max_rcut with the full shell method and
+ max_rcut/2 with the midpoint method.
+ \param [in] sys System whose halo to report
+*/
+double halo_width (const System *sys) {
+    if (sys->parallel_method() == MIDPOINT) {
+	return 0.5*sys->max_rcut();
+    }
+    return sys->max_rcut();
+}
+
+/*!
+ Sets the parallel method of a System from its name, "shell" or "midpoint".  Returns SAFE_EXIT if successful, else ILLEGAL_VALUE.
+ \param [in] name Name of the method
+ \param [in,out] sys System to set the method of
+*/
+int set_parallel_method (const string name, System *sys) {
+    char err_msg[MYERR_FLAG_SIZE];
+    if (name == "shell") {
+	sys->set_parallel_method(FULL_SHELL);
+    } else if (name == "midpoint") {
+	sys->set_parallel_method(MIDPOINT);
+    } else {
+	sprintf(err_msg, "Unknown parallel method %s, must be shell or midpoint", name.c_str());
+	flag_error (err_msg, __FILE__, __LINE__);
+	return ILLEGAL_VALUE;
+    }
+    return SAFE_EXIT;
+}
+
+/*! Given the coordinates of a point, determines the x, y, z ids of the domain within which the point lies.
+ \param [in] pos array containing the coordinates of a point
+ \param [in] sys system passed to be able to utilize final domain decomposition
+ \param [out] xyz_id how many domains away from the lower limit of each dimension the point is
+*/
+void get_domain_ids (const double *pos, const System *sys, int xyz_id[]) {
+
+    vector <double> inbox = pbc (pos, sys->box());
+    for (int m=0; m<NDIM; m++) {
+	xyz_id[m] = floor(inbox[m]/sys->proc_widths[m]);
+	// Guard against round off placing a point just inside the box in a domain past the last one
+	if (xyz_id[m] >= sys->final_proc_breakup[m]) {
+	    xyz_id[m] = sys->final_proc_breakup[m]-1;
+	}
+    }
+}
+
 /*! Given the coordinates of a point, determines within which domain the point lies. This function is overloaded.
  \param [in] pos the vector containing the coordinates of a point
  \param [in] sys system passed to be able to utilize final domain decomposition
 */
 int get_processor (const vector<double> pos, const System *sys) {
 
-	vector <double> inbox = pbc (pos, sys->box());
-    int domain_id, x_id, y_id, z_id;
-    x_id = floor(inbox[0]/sys->proc_widths[0]);
-    y_id = floor(inbox[1]/sys->proc_widths[1]);
-    z_id = floor(inbox[2]/sys->proc_widths[2]);
-    domain_id = x_id + y_id*sys->final_proc_breakup[0] + z_id*sys->final_proc_breakup[0]*sys->final_proc_breakup[1];
-    return domain_id;
+    return get_processor (&pos[0], sys);
+}
+
+/*! Given the coordinates of a point, determines within which domain the point lies. This function is overloaded.
+ \param [in] pos array containing the coordinates of a point
+ \param [in] sys system passed to be able to utilize final domain decomposition
+*/
+int get_processor (const double *pos, const System *sys) {
+
+    int xyz_id[NDIM];
+    get_domain_ids (pos, sys, xyz_id);
+    return get_processor (xyz_id[0], xyz_id[1], xyz_id[2], sys->final_proc_breakup);
 }
 
 /*! Given the coordinates of a point, determines within which domain the point lies. This function is overloaded.
@@ -167,31 +446,78 @@ int get_xyz_ids (const int domain_id, const vector<int>& final_breakup, int xyz_
     return 1;
 }
 
+/*! Given the offset of a neighbouring domain, returns its index in System::send_table
+ \param [in] offset -1, 0 or 1 in each dimension, not all 0
+*/
+int neighbor_index (const int offset[]) {
+
+    const int nvals=3;
+    int value = -1;
+    for (int m=0; m<NDIM; m++) {
+	value += (int)(1.5*abs(offset[m])+0.5*offset[m])*power(nvals, m);
+    }
+    return value;
+}
+
+/*! Returns the index in System::send_table of the neighbour in the opposite direction to the one given
+ \param [in] index index of a neighbour in System::send_table
+*/
+int opposite_neighbor (const int index) {
+
+    const int nvals=3;
+    int value=index+1, opposite=0, digit;
+    for (int m=0; m<NDIM; m++) {
+	digit = value%nvals;
+	value /= nvals;
+	// near lower bound (1) and near upper bound (2) swap, in the middle (0) stays
+	if (digit != 0) {
+	    digit = 3-digit;
+	}
+	opposite += digit*power(nvals, m);
+    }
+    return opposite-1;
+}
+
 /*! Generates the lists of molecules that need to be passed to other processors
+ Atoms are only checked against the borders of the domain, so one which has drifted slightly out of the domain since
+ the last time atoms were moved between processors is still sent to the correct neighbours.
  \param [in,out] sys System to be evaluated
 */
 int gen_send_lists (System *sys) {
     const int ndims=NDIM;
-    const double skin_cutoff=sys->max_rcut();
-    /* Since a particle can have only 3 relationships to a dimension of the box, we define
+    const double skin_cutoff=halo_width (sys);
+    const vector<double> box=sys->box();
+    /* Since a particle can have only 4 relationships to a dimension of the box, we define
        0 = in the middle (itm),
        1 = near lower bound (nlb)
-       2 = near upper bound (nub) */
-    const int itm=0, nlb=1, nub=2;
+       2 = near upper bound (nub)
+       3 = near both bounds (nbb), only possible when the domain is narrower than twice the halo */
+    const int itm=0, nlb=1, nub=2, nbb=3;
     vector<int> is_near_border;
     is_near_border.resize(ndims);
     vector<int> goes_to;
+    double dist, slack;
 
-    sys->send_lists.clear();
+    sys->send_lists.resize(NNEIGHBORS);
     for (int i=0; i<NNEIGHBORS; i++) {
+		sys->send_lists[i].clear();
 		sys->send_list_size[i] = 0;
     }
     for (int i=0; i < sys->natoms(); i++) {
 		goes_to.clear();
 		for (int j=0; j<ndims; j++) {
-			if (sys->get_atom(i)->pos[j] < (sys->xyz_limits[j][0]+skin_cutoff)) {
+			// Distance from the lower bound of the domain, wrapped to lie within half the space outside the domain of it
+			slack = 0.5*(box[j]-sys->proc_widths[j]);
+			dist = sys->get_atom(i)->pos[j] - sys->xyz_limits[j][0];
+			dist -= floor((dist+slack)/box[j])*box[j];
+			if (sys->final_proc_breakup[j] == 1) {
+				// Undivided, the only neighbour along this dimension is this domain itself
+				is_near_border[j] = itm;
+			} else if (dist < skin_cutoff && dist > (sys->proc_widths[j]-skin_cutoff)) {
+				is_near_border[j] = nbb;
+			} else if (dist < skin_cutoff) {
 				is_near_border[j] = nlb;
-			} else if  (sys->get_atom(i)->pos[j] > (sys->xyz_limits[j][1]-skin_cutoff)) {
+			} else if  (dist > (sys->proc_widths[j]-skin_cutoff)) {
 				is_near_border[j] = nub;
 			} else {
 				is_near_border[j] = itm;
@@ -199,6 +525,10 @@ int gen_send_lists (System *sys) {
 		}
 		gen_goes_to(is_near_border, goes_to, ndims);
 		for (vector<int>::iterator iter=goes_to.begin(); iter!=goes_to.end(); iter++) {
+			// Atoms are never sent to this processor itself, e.g. when a dimension is not divided
+			if (sys->send_table[*iter] == sys->rank()) {
+				continue;
+			}
 			sys->send_lists[*iter].push_back(*(sys->get_atom(i)));
 			sys->send_list_size[*iter]++;
 		}
@@ -212,8 +542,7 @@ int gen_send_lists (System *sys) {
 */
 int gen_send_table (System *sys) {
 
-    const int nvals=NDIM;
-    int xyz_id[NDIM], ngh_xyz_id[NDIM], domain_id, value;
+    int xyz_id[NDIM], ngh_xyz_id[NDIM], offset[NDIM], domain_id;
 
     for (int i=0; i<NDIM; i++) {
 	xyz_id[i] = sys->xyz_id[i];
@@ -221,10 +550,11 @@ int gen_send_table (System *sys) {
     for (int i=-1; i<=1; i++) {
 	for (int j=-1; j<=1; j++) {
 	    for (int k=-1; k<=1; k++) {
-		ngh_xyz_id[0] = i + xyz_id[0];
-		ngh_xyz_id[1] = j + xyz_id[1];
-		ngh_xyz_id[2] = k + xyz_id[2];
+		offset[0] = i;
+		offset[1] = j;
+		offset[2] = k;
 		for (int m=0; m<NDIM; m++) {
+		    ngh_xyz_id[m] = offset[m] + xyz_id[m];
 		    if (ngh_xyz_id[m] < 0) {
 			ngh_xyz_id[m] = sys->final_proc_breakup[m]-1;
 		    } else if (ngh_xyz_id[m] == sys->final_proc_breakup[m]) {
@@ -233,8 +563,7 @@ int gen_send_table (System *sys) {
 		}
 		domain_id = ngh_xyz_id[0] + ngh_xyz_id[1]*sys->final_proc_breakup[0] + ngh_xyz_id[2]*sys->final_proc_breakup[0]*sys->final_proc_breakup[1];
 		if (abs(i)+abs(j)+abs(k) != 0) {
-		    value = (1.5*abs(i)+0.5*i)+(1.5*abs(j)+0.5*j)*nvals+(1.5*abs(k)+0.5*k)*nvals*nvals - 1;
-		    sys->send_table[value] = domain_id;
+		    sys->send_table[neighbor_index(offset)] = domain_id;
 		}
 	    }
 	}
@@ -243,35 +572,34 @@ int gen_send_table (System *sys) {
 }
 
 /*! Generates the list of neighbours a particle should be sent to based on the borders its near
- \param [in] is_near_border information about which borders an atom is near
+ A particle near borders in several dimensions is sent across every combination of those borders (faces, edges and corners), each exactly once.
+ \param [in] is_near_border information about which borders an atom is near (0 = neither, 1 = lower, 2 = upper, 3 = both)
  \param goes_to [in] vector containing the ids the current atoms needs to be communicated to
  \param [in] ndims the number of dimensions of the simulation
 */
 void gen_goes_to (const vector<int>& is_near_border, vector<int>& goes_to, const int ndims) {
 
-    int value=0;
-    vector<int> remaining;
-    remaining.resize(ndims);
-    /* Since a particle can have only 3 realtionships to a dimension
-       near lower bound, near upper bound or in the middle. Hence the variable nvals */
+    /* A neighbour lies in one of 3 directions along each dimension:
+       the same domain (0), the lower side (1) or the upper side (2). Hence the variable nvals */
     const static int nvals=3;
-    for (int i=0; i<ndims; i++) {
-	remaining[i] = is_near_border[i];
-	value += is_near_border[i]*power(nvals, i);
-    }
-    value--;
-    if (value == -1) {
-	return;
-    } else {
-	goes_to.push_back(value);
-	for (int j=0; j<ndims; j++) {
-	    if (remaining[j] != 0) {
-		remaining[j] = 0;
-		gen_goes_to (remaining, goes_to, ndims);
-		remaining[j] = is_near_border[j];
+    int value, direction, remaining;
+    bool valid;
+    for (int combination=1; combination<power(nvals, ndims); combination++) {
+	value = 0;
+	valid = true;
+	remaining = combination;
+	for (int i=0; i<ndims; i++) {
+	    direction = remaining%nvals;
+	    remaining /= nvals;
+	    if (direction != 0 && is_near_border[i] != direction && is_near_border[i] != nvals) {
+		valid = false;
+		break;
 	    }
+	    value += direction*power(nvals, i);
+	}
+	if (valid) {
+	    goes_to.push_back(value-1);
 	}
-	return;
     }
 }
 
@@ -287,32 +615,88 @@ int power (int base, int exponent) {
     return result;
 }
 
+/*! Exchanges lists of atoms with every neighbouring domain.
+ Messages are tagged with the direction they travel in, so they are matched correctly even when several neighbours
+ are the same processor (e.g. when a dimension is only divided in two).  Neighbours which are this processor itself are skipped.
+ \param [in] sys System whose neighbour table is used
+ \param [in] outgoing atoms to send towards each of the NNEIGHBORS neighbours
+ \param [out] incoming atoms received from each of the NNEIGHBORS neighbours
+*/
+int exchange_atoms (System *sys, vector< vector<Atom> >& outgoing, vector< vector<Atom> >& incoming) {
+
+    MPI_Request req[2*NNEIGHBORS];
+    MPI_Status stat[2*NNEIGHBORS];
+    int num_send[NNEIGHBORS], num_recv[NNEIGHBORS], nreq=0;
+
+    incoming.resize(NNEIGHBORS);
+    for (int i=0; i<NNEIGHBORS; i++) {
+	num_send[i] = outgoing[i].size();
+	num_recv[i] = 0;
+	if (sys->send_table[i] == sys->rank()) {
+	    continue;
+	}
+	MPI_Isend (&num_send[i], 1, MPI_INT, sys->send_table[i], i, sys->domain_comm, &req[nreq++]);
+	MPI_Irecv (&num_recv[i], 1, MPI_INT, sys->send_table[i], opposite_neighbor(i), sys->domain_comm, &req[nreq++]);
+    }
+    MPI_Waitall (nreq, req, stat);
+
+    nreq = 0;
+    for (int i=0; i<NNEIGHBORS; i++) {
+	incoming[i].resize(num_recv[i]);
+	if (num_send[i] > 0) {
+	    MPI_Isend (&outgoing[i].front(), num_send[i], MPI_ATOM, sys->send_table[i], i, sys->domain_comm, &req[nreq++]);
+	}
+	if (num_recv[i] > 0) {
+	    MPI_Irecv (&incoming[i].front(), num_recv[i], MPI_ATOM, sys->send_table[i], opposite_neighbor(i), sys->domain_comm, &req[nreq++]);
+	}
+    }
+    MPI_Waitall (nreq, req, stat);
+    return 0;
+}
+
 /*! Communicates the atoms in the skin regions of the processors to the appropriate neighbours
  \param sys [in,out] System to be evaluated
 */
 int communicate_skin_atoms (System *sys) {
 
-    MPI_Barrier (MPI_COMM_WORLD);
-    MPI_Request req[52], req2[52];
-    MPI_Status stat[52];
+    exchange_atoms (sys, sys->send_lists, sys->get_lists);
     for (int i=0; i<NNEIGHBORS; i++) {
-	MPI_Isend (&sys->send_list_size[i], 1, MPI_INT, sys->send_table[i], sys->rank(), MPI_COMM_WORLD, &req[i]);
-	MPI_Irecv (&sys->get_list_size[i], 1, MPI_INT, sys->send_table[i], sys->send_table[i], MPI_COMM_WORLD, &req[NNEIGHBORS+i]);
-    }
-    MPI_Waitall (52, req, stat);
-    
-    for(int i=0; i<NNEIGHBORS; i++) {
-	sys->get_lists[i].reserve(sys->get_list_size[i]);
+	sys->get_list_size[i] = sys->get_lists[i].size();
+	if (sys->get_list_size[i] > 0) {
+	    sys->add_ghost_atoms(sys->get_list_size[i], &(sys->get_lists[i].front()));
+	}
     }
+    return 0;
+}
+
+/*! Sends the forces accumulated on ghost atoms back to the processors owning them and adds them to the forces on the owned atoms.
+ Each ghost is returned once, to the neighbour it was received from in the last communicate_skin_atoms().
+ \param sys [in,out] System to be evaluated
+*/
+int return_ghost_forces (System *sys) {
+    vector< vector<Atom> > outgoing(NNEIGHBORS), incoming;
+    vector<bool> returned (sys->total_atoms(), false);
+    int index;
 
     for (int i=0; i<NNEIGHBORS; i++) {
-	MPI_Isend (&sys->send_lists[i].front(), sys->send_list_size[i], MPI_ATOM, sys->send_table[i], sys->rank(), MPI_COMM_WORLD, &req2[i]);
-	MPI_Irecv (&sys->get_lists[i].front(), sys->get_list_size[i], MPI_ATOM, sys->send_table[i], sys->send_table[i], MPI_COMM_WORLD, &req2[NNEIGHBORS+i]);
+	for (int j=0; j<sys->get_list_size[i]; j++) {
+	    index = sys->local_index(sys->get_lists[i][j].sys_index);
+	    if (index >= sys->natoms() && !returned[index]) {
+		outgoing[i].push_back(*(sys->get_atom(index)));
+		returned[index] = true;
+	    }
+	}
     }
-    MPI_Waitall (52, req2, stat);
-
+    exchange_atoms (sys, outgoing, incoming);
     for (int i=0; i<NNEIGHBORS; i++) {
-	sys->add_ghost_atoms(sys->get_list_size[i], &(sys->get_lists[i].front()));
+	for (unsigned int j=0; j<incoming[i].size(); j++) {
+	    index = sys->local_index(incoming[i][j].sys_index);
+	    if (index >= 0 && index < sys->natoms()) {
+		for (int m=0; m<NDIM; m++) {
+		    sys->get_atom(index)->force[m] += incoming[i][j].force[m];
+		}
+	    }
+	}
     }
     return 0;
 }
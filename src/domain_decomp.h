@@ -4,30 +4,63 @@
  \brief Header file for domain decomposition
 */
 
+#ifndef DOMAIN_DECOMP_H_
+#define DOMAIN_DECOMP_H_
+
 #include "common.h"
 #include "system.h"
 #include "mpi.h"
 
 using namespace std;
 
-//! Given the box size and factors of nprocs, checks which combination generates the most cubic domains
-void gen_sets (const vector<int>& factors, const double box[], const int level, double& final_diff, vector<int>& final_breakup, int add);
+//! Given the box size, cutoff and nprocs, chooses the processor grid with the smallest ghost shell volume
+int select_grid (const double box[], const int nprocs, const double rcut, int breakup[]);
 
-//! Given a number returns the prime factors (does not count 1 as a prime factor)
-vector<int> factorize (const int nprocs);
+//! Ratio of the ghost shell volume a domain imports to the volume of the domain itself
+double halo_ratio (const double widths[], const int breakup[], const double rcut);
 
 //! Decomposes the box into domains for each processor to handle
-int init_domain_decomp (const vector<double> box, const int nprocs, double widths[], vector<int>& final_breakup);
+int init_domain_decomp (const vector<double> box, const int nprocs, double widths[], vector<int>& final_breakup, const double rcut = 0.0);
+
+//! Decomposes a System among the processors and keeps only the atoms in this processor's domain
+int setup_domain_decomp (System *sys);
+
+//! Chooses the block of domains each node should handle to keep halo traffic within nodes
+int node_block (const int breakup[], const double widths[], const double rcut, const int node_size, int block[]);
+
+//! Predicts the halo traffic between processors on different nodes for a given placement of domains
+double internode_halo_bytes (const System *sys, const vector<int>& rank_of_domain, const vector<int>& node_of_rank);
+
+//! Assigns domains to processors so that neighbouring domains share a node where possible
+int place_domains (System *sys);
+
+//! Width of the region around a domain from which atoms are imported, which depends on the parallel method
+double halo_width (const System *sys);
+
+//! Sets the parallel method of a System from its name
+int set_parallel_method (const string name, System *sys);
+
+//! Given the co-ordinates of a point, determines the x, y, z ids of the domain within which the point lies
+void get_domain_ids (const double *pos, const System *sys, int xyz_id[]);
 
 //! Given the co-ordinates of a point, determines within which domain the point lies
 int get_processor (const vector<double> pos, const System *sys);
 
+//! Given the co-ordinates of a point, determines within which domain the point lies
+int get_processor (const double *pos, const System *sys);
+
 //! Given the x, y, z ids of a domain, determines the domain id (useful for locating neighbouring domains)
-int get_processor_id (const int x_id, const int y_id, const int z_id, const vector<int>& final_breakup);
+int get_processor (const int x_id, const int y_id, const int z_id, const vector<int>& final_breakup);
 
 //! Given a domain_id specifies the x, y, z ids of the domain
 int get_xyz_ids (const int domain_id, const vector<int>& final_breakup, int xyz_id[]);
 
+//! Given the offset (-1, 0 or 1 in each dimension) of a neighbouring domain, returns its index in System::send_table
+int neighbor_index (const int offset[]);
+
+//! Returns the index in System::send_table of the neighbour in the opposite direction
+int opposite_neighbor (const int index);
+
 //! Generates the lists of molecules that need to be passed to other processors
 int gen_send_lists (System *sys);
 
@@ -40,5 +73,13 @@ void gen_goes_to (const vector<int>& is_near_border, vector<int>& goes_to, const
 //! Computes the exponentiation of an integer by an integral power
 int power (int base, int exponent);
 
+//! Exchanges lists of atoms with every neighbouring domain
+int exchange_atoms (System *sys, vector< vector<Atom> >& outgoing, vector< vector<Atom> >& incoming);
+
 //! Communicates the atoms in the skin regions of the processors to the appropriate neighbours
 int communicate_skin_atoms (System *sys);
+
+//! Returns the forces accumulated on ghost atoms to the processors owning them
+int return_ghost_forces (System *sys);
+
+#endif
@@ -15,188 +15,170 @@ using namespace std;
 **/
 int send_atoms(System *sys) {
 	char err_msg[MYERR_FLAG_SIZE];
-	const vector<double> box = sys->box();
-
-	int nprocs, rank;
-	MPI_Comm_size (MPI_COMM_WORLD, &nprocs);
-	MPI_Comm_rank (MPI_COMM_WORLD, &rank);
+	int xyz_id[NDIM], offset[NDIM];
+	bool moved;
 	
-	// store number of atoms to send to and receive from the processor on the left and on the right
-	int num_to_left = 0;
-	int num_to_right = 0;
-	int num_from_left, num_from_right;
-	
-	// store atoms to send and receive
-	vector<Atom> to_left;
-	vector<Atom> to_right;
-	vector<Atom> from_left;
-	vector<Atom> from_right;
+	// store atoms to send to and receive from each neighbouring domain
+	vector< vector<Atom> > outgoing(NNEIGHBORS);
+	vector< vector<Atom> > incoming;
 	
 	// store indices of atoms that have been sent (so we can delete them)
 	vector<int> to_delete;
 
-	MPI_Request req[4], req2[4];
-	MPI_Status stat[4], stat2[4];
-
-	int proc_to;
 	for (int i=0; i!=sys->natoms(); ++i) {
-		// calculate the processor for each atom
-		proc_to = floor(pbc(sys->get_atom(i)->pos, box)[PARALLELDIM] / box[PARALLELDIM] * nprocs);
-		if (proc_to == (rank - 1 + nprocs) % nprocs) {
-			to_left.push_back(*(sys->get_atom(i)));
-			num_to_left++;
-			to_delete.push_back(i);
+		// calculate the domain of each atom relative to this one
+		get_domain_ids(sys->get_atom(i)->pos, sys, xyz_id);
+		moved = false;
+		for (int m = 0; m < NDIM; ++m) {
+			offset[m] = xyz_id[m] - sys->xyz_id[m];
+			if (offset[m] > 1) {
+				offset[m] -= sys->final_proc_breakup[m];
+			} else if (offset[m] < -1) {
+				offset[m] += sys->final_proc_breakup[m];
+			}
+			if (offset[m] < -1 || offset[m] > 1) {
+				sprintf(err_msg, "Atom moved too many boxes");
+				flag_error (err_msg, __FILE__, __LINE__);
+				return ILLEGAL_VALUE;
+			}
+			if (offset[m] != 0) {
+				moved = true;
+			}
 		}
-		else if (proc_to == (rank + 1) % nprocs) {
-			to_right.push_back(*(sys->get_atom(i)));
-			num_to_right++;
+		if (moved) {
+			outgoing[neighbor_index(offset)].push_back(*(sys->get_atom(i)));
 			to_delete.push_back(i);
 		}
-		else if (proc_to != rank) {
-			sprintf(err_msg, "Atom moved too many boxes");
-			flag_error (err_msg, __FILE__, __LINE__);
-			return ILLEGAL_VALUE;
-		}			
 	}
 
-	// send number of atoms
-	MPI_Isend(&num_to_left, 1, MPI_INT, (rank - 1 + nprocs) % nprocs, 1, MPI_COMM_WORLD, req);
-	MPI_Irecv(&num_from_left, 1, MPI_INT, (rank - 1 + nprocs) % nprocs, 1, MPI_COMM_WORLD, req+1);
-	MPI_Isend(&num_to_right, 1, MPI_INT, (rank + 1) % nprocs, 1, MPI_COMM_WORLD, req+2);
-	MPI_Irecv(&num_from_right, 1, MPI_INT, (rank + 1) % nprocs, 1, MPI_COMM_WORLD, req+3);
-	MPI_Waitall (4, req, stat);
-
-	// resize atom vectors
-	from_left.resize(num_from_left);
-	from_right.resize(num_from_right);
-	
 	// send atoms
-	MPI_Isend(&to_left[0], num_to_left, MPI_ATOM, (rank - 1 + nprocs) % nprocs, 1, MPI_COMM_WORLD, req2);
-	MPI_Irecv(&from_left[0], num_from_left, MPI_ATOM, (rank - 1 + nprocs) % nprocs, 1, MPI_COMM_WORLD, req2+1);
-	MPI_Isend(&to_right[0], num_to_right, MPI_ATOM, (rank + 1) % nprocs, 1, MPI_COMM_WORLD, req2+2);
-	MPI_Irecv(&from_right[0], num_from_right, MPI_ATOM, (rank + 1) % nprocs, 1, MPI_COMM_WORLD, req2+3);
-	MPI_Waitall (4, req2, stat2);
-
-	// add atoms to system
-	sys->add_atoms(&from_left);
-	sys->add_atoms(&from_right);
+	exchange_atoms(sys, outgoing, incoming);
 
 	// delete atoms that we sent to another system
 	sys->delete_atoms(to_delete);
+
+	// add atoms to system
+	for (int i = 0; i < NNEIGHBORS; ++i) {
+		if (incoming[i].size() > 0) {
+			sys->add_atoms(&incoming[i]);
+		}
+	}
 	
 	MPI_Barrier(MPI_COMM_WORLD);
 	return SAFE_EXIT;
 }
 	
 /*!
+ Calculates the interactions with the midpoint method: every pair of atoms stored on this processor, ghost or not, whose midpoint lies in
+ this processor's domain is evaluated here and only here, so its full energy is counted.  Forces on ghosts are then sent back to their owners.
+ The midpoint is measured from the atom with the lower sys_index so every processor agrees on it exactly.
  Returns SAFE_EXIT if successful, else returns an error flag.
- \param [in] \*sys Pointer to system for which to evaluate the forces
+ \param [in,out] \*sys Pointer to system for which to evaluate the forces
+ \param [in,out] \*potential_energy Potential energy to add this processor's share to
 */
-int force_calc(System *sys) { 
-	const double skin_cutoff = sys->max_rcut();
+int midpoint_forces(System *sys, double *potential_energy) {
 	const vector<double> box = sys->box();
-	double kinetic_energy = 0.0, potential_energy = 0.0, dE, totKE, totPE;
-	int nprocs, rank;
-	MPI_Comm_size (MPI_COMM_WORLD, &nprocs);
-	MPI_Comm_rank (MPI_COMM_WORLD, &rank);
-	
-	// Store number of atoms to send to and receive from the processor on the left and on the right
-	int num_to_left = 0;
-	int num_to_right = 0;
-	int num_from_left, num_from_right;
-	
-	// Store atoms to send and receive
-	vector<Atom> to_left;
-	vector<Atom> to_right;
-	vector<Atom> from_left;
-	vector<Atom> from_right;
+	const double rcut2 = sys->max_rcut()*sys->max_rcut();
+	double xyz[NDIM], midpoint[NDIM];
+	Atom *a1, *a2;
 
-	MPI_Request req[4], req2[4];
-	MPI_Status stat[4], stat2[4];
+	// Ghost copies arrive carrying the forces their owners last computed
+	for (int i=sys->natoms(); i < sys->total_atoms(); ++i) {
+		for (int k = 0; k < NDIM; ++k) {
+			sys->get_atom(i)->force[k] = 0.0;
+		}
+	}
 
-	// Calculate forces between all atoms in the system
-	for (int i=0; i!=sys->natoms(); ++i) {
-		for (int j=i+1; j!=sys->natoms(); ++j) {
-			// A "try" statement is necessary here because interactions can throw errors which need to be caught here
-			try {
-				dE = sys->interact[(*(sys->get_atom(i))).sys_index][(*(sys->get_atom(j))).sys_index].force_energy(sys->get_atom(i), sys->get_atom(j), &box);
+	for (int i=0; i < sys->total_atoms(); ++i) {
+		for (int j=i+1; j < sys->total_atoms(); ++j) {
+			a1 = sys->get_atom(i);
+			a2 = sys->get_atom(j);
+			if (a2->sys_index < a1->sys_index) {
+				swap(a1, a2);
 			}
-			catch (exception& e) {
-				flag_error(e.what(), __FILE__, __LINE__);
-				return ILLEGAL_VALUE;
+			if (min_image_dist2(a1, a2, &box, xyz) >= rcut2) {
+				continue;
 			}
-			potential_energy += dE;
-		}
-		
-		// Remember if atom needs to be sent to neighboring processor
-		// special case for nprocs==2; don't want to send same atom twise
-		if (nprocs == 2) {
- 			if (pbc(sys->get_atom(i)->pos, box)[PARALLELDIM] < rank * box[PARALLELDIM] / nprocs + skin_cutoff) {
-				to_left.push_back(*(sys->get_atom(i)));
-				num_to_left++;
+			for (int k = 0; k < NDIM; ++k) {
+				midpoint[k] = a1->pos[k] + 0.5*xyz[k];
 			}
-			else if  (pbc(sys->get_atom(i)->pos, box)[PARALLELDIM] > (rank + 1) * box[PARALLELDIM] / nprocs - skin_cutoff) {
-				to_right.push_back(*(sys->get_atom(i)));
-				num_to_right++;
+			if (get_processor(midpoint, sys) != sys->rank()) {
+				continue;
 			}
-		} else {
- 			if (pbc(sys->get_atom(i)->pos, box)[PARALLELDIM] < rank * box[PARALLELDIM] / nprocs + skin_cutoff) {
-				to_left.push_back(*(sys->get_atom(i)));
-				num_to_left++;
+			try {
+				*potential_energy += sys->interact[a1->sys_index][a2->sys_index].force_energy(a1, a2, &box);
 			}
-			if  (pbc(sys->get_atom(i)->pos, box)[PARALLELDIM] > (rank + 1) * box[PARALLELDIM] / nprocs - skin_cutoff) {
-				to_right.push_back(*(sys->get_atom(i)));
-				num_to_right++;
+			catch (exception& e) {
+				flag_error(e.what(), __FILE__, __LINE__);
+				return ILLEGAL_VALUE;
 			}
 		}
-		
-		// KE = sum(i,1/2 *m(i)*v(i)*v(i))
-		for (int k = 0; k < NDIM; ++k) {
-			kinetic_energy += 0.5*(sys->get_atom(i)->mass*sys->get_atom(i)->vel[k]*sys->get_atom(i)->vel[k]);
-		}
 	}
+
+	return_ghost_forces(sys);
+	return SAFE_EXIT;
+}
+
+/*!
+ Returns SAFE_EXIT if successful, else returns an error flag.
+ \param [in] \*sys Pointer to system for which to evaluate the forces
+*/
+int force_calc(System *sys) { 
+	const vector<double> box = sys->box();
+	double kinetic_energy = 0.0, potential_energy = 0.0, dE, totKE, totPE;
+	int nprocs, rank;
+	MPI_Comm_size (MPI_COMM_WORLD, &nprocs);
+	MPI_Comm_rank (MPI_COMM_WORLD, &rank);
 	
+	// Import (ghost) atoms within the halo of this domain from the neighbouring domains
 	if (nprocs > 1) {
-		// Send ghost atoms to neighboring processor
-		MPI_Isend(&num_to_left, 1, MPI_INT, (rank - 1 + nprocs) % nprocs, 1, MPI_COMM_WORLD, req);
-		MPI_Irecv(&num_from_left, 1, MPI_INT, (rank - 1 + nprocs) % nprocs, 1, MPI_COMM_WORLD, req+1);
-		MPI_Isend(&num_to_right, 1, MPI_INT, (rank + 1) % nprocs, 1, MPI_COMM_WORLD, req+2);
-		MPI_Irecv(&num_from_right, 1, MPI_INT, (rank + 1) % nprocs, 1, MPI_COMM_WORLD, req+3);
-		MPI_Waitall (4, req, stat);
-
-		from_left.resize(num_from_left);
-		from_right.resize(num_from_right);
-		
-		MPI_Isend(&to_left[0], num_to_left, MPI_ATOM, (rank - 1 + nprocs) % nprocs, 1, MPI_COMM_WORLD, req2);
-		MPI_Irecv(&from_left[0], num_from_left, MPI_ATOM, (rank - 1 + nprocs) % nprocs, 1, MPI_COMM_WORLD, req2+1);
-		MPI_Isend(&to_right[0], num_to_right, MPI_ATOM, (rank + 1) % nprocs, 1, MPI_COMM_WORLD, req2+2);
-		MPI_Irecv(&from_right[0], num_from_right, MPI_ATOM, (rank + 1) % nprocs, 1, MPI_COMM_WORLD, req2+3);
-		MPI_Waitall (4, req2, stat2);
+		gen_send_lists(sys);
+		communicate_skin_atoms(sys);
+	}
 
-		// Calculate interactions between new (ghost) atoms and atoms on processor
+	if (nprocs > 1 && sys->parallel_method() == MIDPOINT) {
+		if (midpoint_forces(sys, &potential_energy) != 0) {
+			return ILLEGAL_VALUE;
+		}
+	} else {
+		// Calculate forces between all atoms in the system
 		for (int i=0; i!=sys->natoms(); ++i) {
-			for (int j=0; j < num_from_left; ++j) {
+			for (int j=i+1; j!=sys->natoms(); ++j) {
+				// A "try" statement is necessary here because interactions can throw errors which need to be caught here
 				try {
-					dE = sys->interact[(*(sys->get_atom(i))).sys_index][from_left[j].sys_index].force_energy(sys->get_atom(i), &from_left[j], &box);
+					dE = sys->interact[(*(sys->get_atom(i))).sys_index][(*(sys->get_atom(j))).sys_index].force_energy(sys->get_atom(i), sys->get_atom(j), &box);
 				}
 				catch (exception& e) {
 					flag_error(e.what(), __FILE__, __LINE__);
 					return ILLEGAL_VALUE;
 				}
-				// Update PE only with interactions from atoms on the left so this energy is not doubly counted in the MPI_Allreduce() below
 				potential_energy += dE;
 			}
-			for (int j=0; j < num_from_right; ++j) {
+			
+			// Calculate interactions between ghost atoms and atoms on processor
+			for (int j=sys->natoms(); j < sys->total_atoms(); ++j) {
 				try {
-					dE = sys->interact[(*(sys->get_atom(i))).sys_index][from_right[j].sys_index].force_energy(sys->get_atom(i), &from_right[j], &box);
+					dE = sys->interact[(*(sys->get_atom(i))).sys_index][(*(sys->get_atom(j))).sys_index].force_energy(sys->get_atom(i), sys->get_atom(j), &box);
 				}
 				catch (exception& e) {
 					flag_error(e.what(), __FILE__, __LINE__);
 					return ILLEGAL_VALUE;
 				}
+				// The processor owning the ghost evaluates this pair too, so only count half the energy so it is not doubly counted in the MPI_Allreduce() below
+				potential_energy += 0.5*dE;
 			}
 		}
-	}	
+	}
+	
+	// KE = sum(i,1/2 *m(i)*v(i)*v(i))
+	for (int i=0; i!=sys->natoms(); ++i) {
+		for (int k = 0; k < NDIM; ++k) {
+			kinetic_energy += 0.5*(sys->get_atom(i)->mass*sys->get_atom(i)->vel[k]*sys->get_atom(i)->vel[k]);
+		}
+	}
+	
+	// Forces on the ghost copies are no longer needed, either they were returned or the processors owning them compute their own
+	sys->clear_ghost_atoms();
 
 	// Keep track of these on all processors (needed for things like thermostats, etc.)
 	MPI_Allreduce (&kinetic_energy, &totKE, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
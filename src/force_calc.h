@@ -10,10 +10,14 @@
 #include "system.h"
 #include "atom.h"
 #include "interaction.h"
+#include "domain_decomp.h"
 
 //! Calculates the forces between the particles in the system
 int force_calc(System *sys);
 
+//! Calculates the forces between the particles whose midpoint lies in this processor's domain
+int midpoint_forces(System *sys, double *potential_energy);
+
 //! Move atoms between processors (domains)
 int send_atoms(System *sys);
 
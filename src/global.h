@@ -33,7 +33,7 @@ const int NDIM = 3;
 //! Nearest neighbors for 3D Domain decomposition
 const int NNEIGHBORS = 26;
 
-//! dimension along which to do the domain decomposition
-const int PARALLELDIM = 0;
+//! Parallel methods; with FULL_SHELL each domain imports atoms within max_rcut of it and computes the pairs involving its own atoms, with MIDPOINT it imports atoms within max_rcut/2 and computes the pairs whose midpoint lies inside it
+enum PARALLEL_METHODS {FULL_SHELL = 0, MIDPOINT = 1};
 
 #endif
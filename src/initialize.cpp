@@ -9,7 +9,7 @@
 /*!
  Parse an XML and energy file to obtain atom and interaction information. Returns 0 if successful, non-zero if failure. Operates in
  a "cascade" between ranks so that each processor (if MPI is used) opens and initializes from the
- input file in order. 
+ input file in order.  Afterwards, each processor keeps only the atoms in its own domain.
  \param [in] xml_filename Name of coordinate file to open and read.
  \param [in] energy_filename Name of file containing bonds, pair potential parameters, etc.
  \param [in,out] \*sys Pointer to System object to store this information in.
@@ -54,6 +54,11 @@ int initialize_from_files (const string xml_filename, const string energy_filena
 	}
 	
 	MPI_Barrier (MPI_COMM_WORLD);
+	
+	// Now that the box and max_rcut are known, divide the atoms among the processors
+	if (check_sum == 0) {
+		check_sum = setup_domain_decomp (sys);
+	}
 	return check_sum;
 }
 
@@ -11,6 +11,7 @@
 #include "global.h"
 #include "mpi.h"
 #include "system.h"
+#include "domain_decomp.h"
 
 using namespace std;
 
@@ -164,11 +164,13 @@ int run (System *sys, Integrator *integrator, const int timesteps, const string
 		}
 	}
 	
-	// Check that the number of processors is not too large such that the width of domain does not exceed max_rcut
-	if (sys->max_rcut() > sys->box()[PARALLELDIM]/nprocs) {
-		sprintf(err_msg, "Domain widths (%g) exceeds maximum r_cut in the system (%g), cannot use this many processors", sys->box()[PARALLELDIM]/nprocs, sys->max_rcut());
-		flag_error (err_msg, __FILE__, __LINE__);
-		return ILLEGAL_VALUE;
+	// Check that the number of processors is not too large such that the halo is wider than a domain
+	for (int m = 0; m < NDIM; ++m) {
+		if (halo_width(sys) > sys->proc_widths[m]) {
+			sprintf(err_msg, "Halo width (%g) exceeds the domain width (%g) along dimension %d, cannot use this many processors", halo_width(sys), sys->proc_widths[m], m);
+			flag_error (err_msg, __FILE__, __LINE__);
+			return ILLEGAL_VALUE;
+		}
 	}
 		
 	// Check their are some atoms in the system
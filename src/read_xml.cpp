@@ -7,8 +7,8 @@
 #include "read_xml.h"
 
 /*!
- Parse an XML file to obtain atom information. Initializes a System object but only stores
- information that belongs to this processor rank according to domain decomposition.
+ Parse an XML file to obtain atom information. Initializes a System object with every atom in the file;
+ the atoms which do not belong to this processor rank are removed later by the domain decomposition (see setup_domain_decomp()).
  Returns SAFE_EXIT if successful, else returns an error flag.
  \param [in] filename Name of file to open and read.
  \param [in,out] \*sys Pointer to System object to store its information at.
@@ -184,10 +184,8 @@ int read_xml (const string filename, System *sys) {
 					new_atoms[i].pos[j] = atom_coords[j];
 				}
 
-				// See if this atom belongs on this processor
-				if (floor(new_atoms[i].pos[PARALLELDIM] / sys->box()[PARALLELDIM] * nprocs) == rank) {
-					atom_belongs.push_back(i);
-				}
+				// Every atom is kept for now; those outside this processor's domain are discarded by setup_domain_decomp() once max_rcut is known
+				atom_belongs.push_back(i);
 				
 				new_atoms[i].sys_index = i;
 			}
@@ -12,6 +12,8 @@
 System::System() {
 	send_lists.reserve(NNEIGHBORS);
 	get_lists.reserve(NNEIGHBORS);
+	domain_comm = MPI_COMM_WORLD;
+	parallel_method_ = FULL_SHELL;
 	num_atoms_ = 0;
 	try {
 		box_.resize(3,-1);
@@ -30,36 +32,29 @@ System::~System() {
 }
 
 /*!
- Remove atoms from the system.  Needs to sort indices because erase() operation reorders things; also, because of this it is fastest to pop from lowest to highest index.
+ Remove atoms from the system.  The remaining atoms are compacted towards the front of local storage in a single pass, preserving their order,
+ so deleting many atoms at once (e.g. after domain decomposition) costs the same as deleting one.
  Returns the number of atoms deleted.
  \param [in] indices Vector of local indices of atoms to delete from the system
 */
 int System::delete_atoms (vector <int> indices) {
-	vector <Atom>::iterator it = atoms_.begin();
-	map <int, int>::iterator map_it;
-  
 	// Sort indices from lowest to highest
 	sort (indices.begin(), indices.end());
   
-	// Pop in this order
+	// Shift every atom down past the deleted atoms preceding it
+	unsigned int next = 0;
 	int shift = 0;
-	int upper;
-	for (unsigned int i = 0; i < indices.size(); ++i) {
-		// Update glob_to_loc for all atoms following the erased atoms
-		if (i < indices.size()-1) {
-			upper = indices[i+1]-shift;
-		} else {
-			upper = atoms_.size();
-		}
-		for (int j = indices[i]+1-shift; j < upper; ++j) {
-			glob_to_loc_id_[atoms_[j].sys_index] -= (shift+1);
+	for (unsigned int j = 0; j < atoms_.size(); ++j) {
+		if (next < indices.size() && indices[next] == (int) j) {
+			glob_to_loc_id_.erase(atoms_[j].sys_index);
+			++next;
+			++shift;
+		} else if (shift > 0) {
+			atoms_[j-shift] = atoms_[j];
+			glob_to_loc_id_[atoms_[j].sys_index] = j-shift;
 		}
-    
-		map_it = glob_to_loc_id_.find(atoms_[indices[i]-shift].sys_index);
-		atoms_.erase(it-shift+indices[i]);
-		glob_to_loc_id_.erase(map_it);
-		++shift;
 	}
+	atoms_.resize(atoms_.size()-shift);
 	num_atoms_ -= shift;
 	return shift;
 }
@@ -126,20 +121,15 @@ vector <int> System::add_atoms (vector <Atom> *new_atoms) {
  \param [in] \*new_atoms Pointer to an array of atoms the user has created elsewhere.
  */
 void System::add_ghost_atoms (const int natoms, Atom *new_atoms) {
+	int index = atoms_.size();
 	for (int i = 0; i < natoms; ++i) {
+		/* Only add the atom to the system if it is not already contained in the system (e.g. received from two neighbours that are the same processor).
+		 Every atom stored, ghost or not, is in glob_to_loc_id_ so this is a single lookup */
+		if (glob_to_loc_id_.find(new_atoms[i].sys_index) != glob_to_loc_id_.end()) {
+			continue;
+		}
 		try {
-			/* Only add the atom to the system if it is not already contained in the system.
-			Do this by going through the atoms and comparing sys_index of the atoms already in the system and the atoms to be added */
-			bool found_atom = false;
-			for (unsigned int j = 0; j < atoms_.size(); ++j) {
-				if (atoms_[j].sys_index == new_atoms[i].sys_index) {
-					found_atom = true;
-					break;
-				}
-			}
-			if (!found_atom) {
-				atoms_.push_back(new_atoms[i]);
-			}
+			atoms_.push_back(new_atoms[i]);
 		}
 		catch (bad_alloc& ba) {
 			char err_msg[MYERR_FLAG_SIZE]; 
@@ -147,6 +137,8 @@ void System::add_ghost_atoms (const int natoms, Atom *new_atoms) {
 			flag_error (err_msg, __FILE__, __LINE__);
 			exit(BAD_MEM);
 		}
+		glob_to_loc_id_[new_atoms[i].sys_index] = index;
+		index++;
 	}
 	return;
 }
@@ -155,8 +147,23 @@ void System::add_ghost_atoms (const int natoms, Atom *new_atoms) {
  Clears the atoms communicated from neighbouring domains from the list of atoms stored in the system leaving only the atoms the system is responsible for.
  */
 void System::clear_ghost_atoms () {
+	for (unsigned int i = num_atoms_; i < atoms_.size(); ++i) {
+		glob_to_loc_id_.erase(atoms_[i].sys_index);
+	}
 	atoms_.erase(atoms_.begin()+num_atoms_, atoms_.end());
 }
+
+/*!
+ Returns the local index of an atom stored on this processor, ghost or not, or -1 if it is not stored here.
+ \param [in] sys_index Global index of the atom
+ */
+int System::local_index (const int sys_index) const {
+	map <int, int>::const_iterator it = glob_to_loc_id_.find(sys_index);
+	if (it == glob_to_loc_id_.end()) {
+		return -1;
+	}
+	return it->second;
+}
 	
 /*!
  Tries to add an atom type to the system, associating a user specified name with an internal index to reference this type in the future.
@@ -53,6 +53,7 @@ public:
 	int rank () {return rank_;}								//!< Return the rank of the system
 	void set_num_atoms (int size) {num_atoms_ = size;}		//!< Manually set the number of atoms in the system
 	void clear_ghost_atoms ();								//!< Clear ghost atoms from system
+	int local_index (const int sys_index) const;			//!< Return the local index of an atom (ghost or not) from its global sys_index, or -1 if it is not stored here
 		
 	/* These are associated with 3D Domain Decomp */
 	int gen_domain_info ();
@@ -64,6 +65,9 @@ public:
 	vector< vector<Atom> > send_lists;
 	int send_list_size[NNEIGHBORS], get_list_size[NNEIGHBORS];
 	vector< vector<Atom> > get_lists;
+	MPI_Comm domain_comm;									//!< Communicator in which each processor's rank is the id of its domain
+	void set_parallel_method (const int method) {parallel_method_ = method;}	//!< Set how pairs are divided among the processors (see PARALLEL_METHODS)
+	int parallel_method () const {return parallel_method_;}					//!< Return how pairs are divided among the processors
 		
 	vector <vector <Interaction> > interact;				//!< Interaction matrix between atoms indexed by global id's (symetric)
 	vector <string> global_atom_types;						//!< Keeps a record of every atom's type
@@ -91,6 +95,7 @@ private:
 	vector < pair <int, int> > bonded_;				//!< Vector of bonded pairs
 	vector <int> bonded_type_;						//!< Vector of types associated with each bond
 	int num_atoms_;									//!< The number of atoms the processor is responsible for
+	int parallel_method_;							//!< How pairs are divided among the processors (see PARALLEL_METHODS)
 	double max_rcut_;								//!< Max cutoff radius for all interactions used in the system
 };
 
@@ -325,7 +325,86 @@ TEST (DomainDecompTest, ThreeFactorLongBox3) {
     EXPECT_EQ (1.0, widths[2]);
     EXPECT_EQ (10, final_breakup[0]);
     EXPECT_EQ (1, final_breakup[1]);
-    EXPECT_EQ (3, final_breakup[2]);    
+    EXPECT_EQ (3, final_breakup[2]);
+}
+
+TEST (DomainDecompTest, ManySmallFactors) {
+    vector<double> box;
+    box.push_back(40.0);
+    box.push_back(40.0);
+    box.push_back(40.0);
+    double widths[3];
+    int nprocs=1024, status;
+    vector<int> final_breakup;
+    status = init_domain_decomp (box, nprocs, widths, final_breakup, 2.5);
+    ASSERT_EQ (0, status);
+    EXPECT_EQ (8, final_breakup[0]);
+    EXPECT_EQ (8, final_breakup[1]);
+    EXPECT_EQ (16, final_breakup[2]);
+    EXPECT_EQ (2.5, widths[2]);
+}
+
+TEST (DomainDecompTest, HaloFavoursUndividedDims) {
+    vector<double> box;
+    box.push_back(20.0);
+    box.push_back(20.0);
+    box.push_back(80.0);
+    double widths[3];
+    int nprocs=64, status;
+    vector<int> final_breakup;
+    status = init_domain_decomp (box, nprocs, widths, final_breakup, 2.5);
+    ASSERT_EQ (0, status);
+    EXPECT_EQ (1, final_breakup[0]);
+    EXPECT_EQ (4, final_breakup[1]);
+    EXPECT_EQ (16, final_breakup[2]);
+    int breakup[3] = {1, 4, 16};
+    EXPECT_DOUBLE_EQ (3.0, halo_ratio (widths, breakup, 2.5));
+}
+
+TEST (DomainDecompTest, RejectNarrowDomains) {
+    vector<double> box;
+    box.push_back(10.0);
+    box.push_back(10.0);
+    box.push_back(10.0);
+    double widths[3];
+    int nprocs=125, status;
+    vector<int> final_breakup;
+    status = init_domain_decomp (box, nprocs, widths, final_breakup, 2.5);
+    EXPECT_EQ (1, status);
+}
+
+TEST (DomainDecompTest, CompactNodeBlock) {
+    int breakup[3] = {8, 8, 8}, block[3];
+    double widths[3] = {2.5, 2.5, 2.5};
+    EXPECT_EQ (0, node_block (breakup, widths, 2.5, 8, block));
+    EXPECT_EQ (2, block[0]);
+    EXPECT_EQ (2, block[1]);
+    EXPECT_EQ (2, block[2]);
+}
+
+TEST (DomainDecompTest, NodeBlockSpansUndividedDims) {
+    int breakup[3] = {1, 4, 16}, block[3];
+    double widths[3] = {20.0, 5.0, 5.0};
+    EXPECT_EQ (0, node_block (breakup, widths, 2.5, 16, block));
+    EXPECT_EQ (1, block[0]);
+    EXPECT_EQ (4, block[1]);
+    EXPECT_EQ (4, block[2]);
+}
+
+TEST (DomainDecompTest, MidpointHalvesHalo) {
+    System mysys;
+    mysys.set_max_rcut(2.5);
+    EXPECT_EQ (2.5, halo_width (&mysys));
+    EXPECT_EQ (0, set_parallel_method ("midpoint", &mysys));
+    EXPECT_EQ (MIDPOINT, mysys.parallel_method());
+    EXPECT_EQ (1.25, halo_width (&mysys));
+    EXPECT_NE (0, set_parallel_method ("neutral", &mysys));
+}
+
+TEST (DomainDecompTest, NoNodeBlock) {
+    int breakup[3] = {3, 3, 3}, block[3];
+    double widths[3] = {5.0, 5.0, 5.0};
+    EXPECT_EQ (1, node_block (breakup, widths, 2.5, 2, block));
 }
 			   			   
 // the following use mpi in the tests
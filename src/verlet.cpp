@@ -7,7 +7,7 @@
 #include "CBEMD.h"
 
 /*!
- \param \*argv[] ./verlet nsteps dt xml_file energy_file animation_file
+ \param \*argv[] ./verlet nsteps dt xml_file energy_file animation_file [parallel_method]
  The input arguments are as follows:
  
  nsteps Number of timesteps to run for.
@@ -19,6 +19,9 @@
  energy_file Energetics and interactions file that contains function parameters.
  
  animation_file File to write the .xyz animation to.
+ 
+ parallel_method Optional, how pairs are divided among processors: shell (default) or midpoint.  midpoint only imports atoms within
+ max_rcut/2 of each domain, which pays off when domains are small compared to max_rcut.
  */
 int main (int argc, char *argv[]) {
 	int check;
@@ -26,8 +29,8 @@ int main (int argc, char *argv[]) {
 	double dt;
 	System mysys; //Declare system
 	
-	if (argc != 6) {
-		fprintf(stderr, "syntax: ./verlet nsteps dt xml_file energy_file animation_file\n");
+	if (argc != 6 && argc != 7) {
+		fprintf(stderr, "syntax: ./verlet nsteps dt xml_file energy_file animation_file [parallel_method]\n");
 		return ILLEGAL_VALUE;
 	}
 	
@@ -52,6 +55,14 @@ int main (int argc, char *argv[]) {
 	if (check != 0) {
 		goto finalize;
 	}
+
+	// Choose the parallel method
+	if (argc == 7) {
+		check = set_parallel_method (argv[6], &mysys);
+		if (check != 0) {
+			goto finalize;
+		}
+	}
 	
 	// Initialize coordinates
 	check = initialize_from_files (argv[3], argv[4], &mysys);